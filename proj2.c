@@ -4,6 +4,8 @@
  * @author Kristián Kičinka
  */
 
+#define _GNU_SOURCE
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -19,8 +21,18 @@
 #include <fcntl.h>
 #include <limits.h>
 #include <sys/wait.h>
+#include <sys/uio.h>
+#include <errno.h>
+#include <signal.h>
 
 #define BASE 10
+#define EVENT_LINE_MAX 64
+#define QUEUE_CAPACITY 1024
+#define WRITER_BATCH 256
+#define WRITER_FLUSH_INTERVAL 1000
+#define MAX_ELVES 999
+#define MAX_REINDEERS 19
+#define MAX_PROCESSES (MAX_ELVES + MAX_REINDEERS + 1)
 
 
 // ERROR NUMBERS
@@ -29,7 +41,8 @@ typedef enum {
     FILE_ERROR,
     MEM_ERROR,
     SEM_ERROR,
-    PROC_ERROR
+    PROC_ERROR,
+    WRITE_ERROR
 
 }error_type;
 
@@ -57,9 +70,22 @@ typedef enum {
     REINDEER_GET
 }reindeer_texts;
 
+// OUTPUT EVENT STRUCTURE
+typedef struct event{
+    int length;
+    char text[EVENT_LINE_MAX];
+}event_t;
+
 // OUTPUT FILE
 FILE *out_file;
 
+// WRITER PROCESS
+pid_t writer_pid = 0;
+
+// SANTA, ELF AND REINDEER PROCESSES
+pid_t process_pids[MAX_PROCESSES];
+int process_count = 0;
+
 // SHARED MEMORY DECLARATION
 int *workshop_elf_counter;
 int *active_reindeer_counter;
@@ -67,6 +93,10 @@ bool *workshop_state;
 int *task_counter;
 int *remaining_elves;
 unsigned *time_seed;
+event_t *event_queue;
+unsigned long *queue_tail;
+bool *writer_parked;
+bool *writer_stopping;
 
 // SEMAPHORES DECLARATION
 sem_t *santa_semaphore = NULL;
@@ -76,6 +106,8 @@ sem_t *elf_help_semaphore = NULL;
 sem_t *christmas_semaphore = NULL;
 sem_t *writing_semaphore = NULL;
 sem_t *memory_semaphore = NULL;
+sem_t *queue_free_semaphore = NULL;
+sem_t *writer_semaphore = NULL;
 
 // PROGRAM PARAMETERS STRUCTURE
 typedef struct prog_params{
@@ -94,6 +126,13 @@ void initialize_semaphores();
 void initialize_memory();
 void uninitialize_semaphores();
 void uninitialize_memory();
+event_t *event_reserve();
+void event_commit();
+void writer_process();
+void writer_wake();
+bool writer_flush(int fd, unsigned long head, int count);
+bool writer_stop();
+void stop_processes();
 void santa_output_text(santa_texts text);
 void elf_output_text(elf_texts text, int elf_id);
 void reindeer_output_text(reindeer_texts text, int reindeer_id);
@@ -123,13 +162,29 @@ int main( int argc, char *argv[] ) {
     (*workshop_state) = true; // false = closed ; true = open
     (*task_counter) = 0;
     (*time_seed) = time(NULL);
+    (*queue_tail) = 0;
+    (*writer_parked) = false;
+    (*writer_stopping) = false;
+
+    // Creating writer process
+    switch (writer_pid = fork()){
+    case 0 :
+        writer_process();
+        break;
+    case -1 :
+        error_message(PROC_ERROR);
+        break;
+    default :
+        break;
+    }
     
     // Creating needed processes
     int sum = program_parameters.elfs_count + program_parameters.reindeers_count;
+    pid_t pid;
     for (int id = 0; id < sum +1 ; id++){
         if(id < program_parameters.elfs_count +1){
 
-            switch (fork()){
+            switch (pid = fork()){
             case 0 :
                 if(id == 0)
                     santa_process(&program_parameters);
@@ -140,11 +195,12 @@ int main( int argc, char *argv[] ) {
                 error_message(PROC_ERROR);
                 break;
             default :
+                process_pids[process_count++] = pid;
                 break;
             }
         }else{
 
-            switch (fork()){
+            switch (pid = fork()){
             case 0 :
                 reindeer_process(id - program_parameters.elfs_count , &program_parameters);
                 break;
@@ -152,16 +208,35 @@ int main( int argc, char *argv[] ) {
                 error_message(PROC_ERROR);
                 break;
             default :
+                process_pids[process_count++] = pid;
                 break;
             }
         }
     }
     
     // Waiting for all processes
-    for (int id = 0; id < sum + 1; id++){
-        wait(NULL);
+    int running = process_count;
+    while (running > 0){
+        if((pid = wait(NULL)) == -1){
+            if(errno == EINTR)
+                continue;
+            break;
+        }
+        if(pid == writer_pid){
+            writer_pid = 0;
+            error_message(WRITE_ERROR);
+        }
+        for (int i = 0; i < process_count; i++){
+            if(process_pids[i] == pid){
+                process_pids[i] = 0;
+                running--;
+            }
+        }
     }
+    process_count = 0;
 
+    if(!writer_stop())
+        error_message(WRITE_ERROR);
     uninitialize_memory();
     uninitialize_semaphores();
     
@@ -202,12 +277,12 @@ bool prepare_values(int argc, char *argv[], program_parameters_t *program_parame
         return true;
     }
     int param_01 = strtol(argv[1],&tmp,BASE);
-    if(*tmp =='\0' && param_01 > 0 && param_01 < 1000 ){
+    if(*tmp =='\0' && param_01 > 0 && param_01 <= MAX_ELVES ){
         program_parameters->elfs_count = param_01;
         err_count ++;
     }
     int param_02 = strtol(argv[2],&tmp,BASE);
-    if (*tmp =='\0' && param_02 > 0 && param_02 < 20) {
+    if (*tmp =='\0' && param_02 > 0 && param_02 <= MAX_REINDEERS) {
         program_parameters->reindeers_count = param_02;
         err_count ++;
     }
@@ -286,6 +361,10 @@ void initialize_semaphores(){
         error = true;
     if((christmas_semaphore = mmap(NULL, sizeof(sem_t), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, 0, 0)) == MAP_FAILED)
         error = true;
+    if((queue_free_semaphore = mmap(NULL, sizeof(sem_t), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, 0, 0)) == MAP_FAILED)
+        error = true;
+    if((writer_semaphore = mmap(NULL, sizeof(sem_t), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, 0, 0)) == MAP_FAILED)
+        error = true;
         
     
 
@@ -303,6 +382,10 @@ void initialize_semaphores(){
         error = true;
     if((sem_init(christmas_semaphore,1,0)) == -1)
         error = true;
+    if((sem_init(queue_free_semaphore,1,QUEUE_CAPACITY)) == -1)
+        error = true;
+    if((sem_init(writer_semaphore,1,0)) == -1)
+        error = true;
     
     if(error == true){
         uninitialize_memory();
@@ -336,6 +419,10 @@ void uninitialize_semaphores(){
         error = true;
     if((sem_destroy(christmas_semaphore)) == -1)
         error = true;
+    if((sem_destroy(queue_free_semaphore)) == -1)
+        error = true;
+    if((sem_destroy(writer_semaphore)) == -1)
+        error = true;
     
     munmap(santa_semaphore,sizeof(sem_t));
     munmap(reindeer_semaphore,sizeof(sem_t));
@@ -344,6 +431,8 @@ void uninitialize_semaphores(){
     munmap(memory_semaphore,sizeof(sem_t));
     munmap(elf_help_semaphore,sizeof(sem_t));
     munmap(christmas_semaphore,sizeof(sem_t));
+    munmap(queue_free_semaphore,sizeof(sem_t));
+    munmap(writer_semaphore,sizeof(sem_t));
     
     if(error == true){
         uninitialize_memory();
@@ -376,6 +465,14 @@ void initialize_memory(){
         error = true;
     if ((time_seed = mmap(NULL, sizeof(unsigned), PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_SHARED, 0, 0)) == MAP_FAILED)
         error = true;   
+    if ((event_queue = mmap(NULL, sizeof(event_t) * QUEUE_CAPACITY, PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_SHARED, 0, 0)) == MAP_FAILED)
+        error = true;
+    if ((queue_tail = mmap(NULL, sizeof(unsigned long), PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_SHARED, 0, 0)) == MAP_FAILED)
+        error = true;
+    if ((writer_parked = mmap(NULL, sizeof(bool), PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_SHARED, 0, 0)) == MAP_FAILED)
+        error = true;
+    if ((writer_stopping = mmap(NULL, sizeof(bool), PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_SHARED, 0, 0)) == MAP_FAILED)
+        error = true;
 
     if(error == true){
         uninitialize_memory();
@@ -402,7 +499,233 @@ void uninitialize_memory(){
    munmap(task_counter,sizeof(int));
    munmap(remaining_elves,sizeof(int));
    munmap(time_seed,sizeof(unsigned));
+   munmap(event_queue,sizeof(event_t) * QUEUE_CAPACITY);
+   munmap(queue_tail,sizeof(unsigned long));
+   munmap(writer_parked,sizeof(bool));
+   munmap(writer_stopping,sizeof(bool));
+
+}
 
+/*!
+ * @name    event_reserve
+ * 
+ * @brief    This function reserve next slot in the output queue.
+ * 
+ * @details     The function wait for free slot, lock writing semaphore 
+ *              and increment task counter. Slots are reserved in the same order 
+ *              as task counter, so the writer keeps order of messages.
+ *              The writing semaphore stays locked until event_commit.
+ * 
+ * @return      reserved slot for the message.
+*/
+event_t *event_reserve(){
+    sem_wait(queue_free_semaphore);
+    sem_wait(writing_semaphore);
+    *(task_counter)+=1;
+    event_t *event = &event_queue[(*queue_tail) % QUEUE_CAPACITY];
+    (*queue_tail)+=1;
+    return event;
+}
+
+/*!
+ * @name    event_commit
+ * 
+ * @brief    This function pass reserved slot to the writer process.
+ * 
+ * @details     The writer is woken only when it is parked, 
+ *              so it is not woken by every message.
+ * 
+*/
+void event_commit(){
+    writer_wake();
+    sem_post(writing_semaphore);
+}
+
+/*!
+ * @name    writer_wake
+ * 
+ * @brief    This function wake parked writer process.
+ * 
+ * @details     The function has to be called with locked writing semaphore.
+ * 
+*/
+void writer_wake(){
+    if((*writer_parked) == true){
+        (*writer_parked) = false;
+        sem_post(writer_semaphore);
+    }
+}
+
+/*!
+ * @name    writer_process
+ * 
+ * @brief    This function represent writer process.
+ * 
+ * @details     The writer takes messages from the output queue in order 
+ *              and writes them to the output file. When the queue is empty, 
+ *              writer parks until a new message comes. Then it waits 
+ *              WRITER_FLUSH_INTERVAL microseconds (or until writer_stop), 
+ *              so more messages are collected,
+ *              and writes batches of maximum WRITER_BATCH messages by one writev call. 
+ *              Writer ends after writer_stop when all messages are written.
+ *              After write error writer keeps taking messages, so no process 
+ *              is blocked, and ends with exit code 1.
+ * 
+*/
+void writer_process(){
+    int fd = fileno(out_file);
+    unsigned long head = 0;
+    unsigned long tail;
+    bool stop;
+    bool error = false;
+
+    while (true){
+        while (sem_wait(writing_semaphore) == -1 && errno == EINTR)
+            ;
+        tail = (*queue_tail);
+        stop = (*writer_stopping);
+        if(tail == head && stop == false)
+            (*writer_parked) = true;
+        sem_post(writing_semaphore);
+
+        if(tail == head){
+            if(stop == true)
+                break;
+            while (sem_wait(writer_semaphore) == -1 && errno == EINTR)
+                ;
+            continue;
+        }
+
+        if(stop == false && tail - head < WRITER_BATCH){
+            struct timespec deadline;
+            clock_gettime(CLOCK_MONOTONIC, &deadline);
+            deadline.tv_nsec += WRITER_FLUSH_INTERVAL * 1000L;
+            deadline.tv_sec += deadline.tv_nsec / 1000000000L;
+            deadline.tv_nsec %= 1000000000L;
+            while (sem_clockwait(writer_semaphore, CLOCK_MONOTONIC, &deadline) == -1 && errno == EINTR)
+                ;
+            while (sem_wait(writing_semaphore) == -1 && errno == EINTR)
+                ;
+            tail = (*queue_tail);
+            sem_post(writing_semaphore);
+        }
+
+        while (head != tail){
+            int count = tail - head < WRITER_BATCH ? (int)(tail - head) : WRITER_BATCH;
+            if(!writer_flush(fd, head, count))
+                error = true;
+            head += count;
+            for (int i = 0; i < count; i++)
+                sem_post(queue_free_semaphore);
+        }
+    }
+    exit(error ? 1 : 0);
+}
+
+/*!
+ * @name    writer_flush
+ * 
+ * @brief    This function write batch of messages to output file.
+ * 
+ * @details     The function writes messages directly from the output queue 
+ *              by writev and repeats it after partial write.
+ * 
+ * @param       fd    File descriptor of output file.
+ * @param       head    Position of first message in the output queue.
+ * @param       count    Count of messages in the batch.
+ * 
+ * @return      false if the batch could not be written, true otherwise.
+*/
+bool writer_flush(int fd, unsigned long head, int count){
+    struct iovec iov[WRITER_BATCH];
+
+    for (int i = 0; i < count; i++){
+        event_t *event = &event_queue[(head + i) % QUEUE_CAPACITY];
+        iov[i].iov_base = event->text;
+        iov[i].iov_len = event->length;
+    }
+
+    struct iovec *current = iov;
+    while (count > 0){
+        ssize_t written = writev(fd, current, count);
+        if(written == -1){
+            if(errno == EINTR)
+                continue;
+            return false;
+        }
+        while (count > 0 && (size_t)written >= current->iov_len){
+            written -= current->iov_len;
+            current++;
+            count--;
+        }
+        if(count > 0){
+            current->iov_base = (char *)current->iov_base + written;
+            current->iov_len -= written;
+        }
+    }
+    return true;
+}
+
+/*!
+ * @name    writer_stop
+ * 
+ * @brief    This function stop writer process.
+ * 
+ * @details     The function lock the output queue, stop processes that are still 
+ *              running (only on error path), tell the writer to stop 
+ *              and wait until writer writes all messages.
+ * 
+ * @return      false if the writer failed, true otherwise.
+*/
+bool writer_stop(){
+    int status = 0;
+    pid_t waited;
+
+    if(writer_pid <= 0 && process_count == 0)
+        return true;
+
+    while (sem_wait(writing_semaphore) == -1 && errno == EINTR)
+        ;
+
+    stop_processes();
+
+    if(writer_pid <= 0){
+        sem_post(writing_semaphore);
+        return true;
+    }
+
+    (*writer_stopping) = true;
+    (*writer_parked) = false;
+    sem_post(writer_semaphore);
+    sem_post(writing_semaphore);
+
+    while ((waited = waitpid(writer_pid, &status, 0)) == -1 && errno == EINTR)
+        ;
+    writer_pid = 0;
+
+    return waited != -1 && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+/*!
+ * @name    stop_processes
+ * 
+ * @brief    This function kill and wait for all created santa, elf and reindeer processes.
+ * 
+ * @details     The function is called with locked writing semaphore, 
+ *              so no process is killed in the middle of passing a message.
+ *              Already waited processes are skipped.
+ * 
+*/
+void stop_processes(){
+    for (int i = 0; i < process_count; i++){
+        if(process_pids[i] > 0)
+            kill(process_pids[i], SIGKILL);
+    }
+    for (int i = 0; i < process_count; i++){
+        if(process_pids[i] > 0)
+            waitpid(process_pids[i], NULL, 0);
+    }
+    process_count = 0;
 }
 
 /*!
@@ -411,34 +734,29 @@ void uninitialize_memory(){
  * @brief    This function send santa message to output file.
  * 
  * @details     The function choose right santa message by the enum value
- *              and will send it to the output file.
+ *              and will pass it to the writer process.
  *            
  * @param       text    The enum value thaht represent needed message.
  * 
 */
 void santa_output_text(santa_texts text){
   
-    sem_wait(writing_semaphore);
-        *(task_counter)+=1;
+    event_t *event = event_reserve();
         switch (text){
             case SANTA_SLEEP:
-                fprintf(out_file,"%d: Santa: going to sleep\n", *(task_counter));
-                fflush(NULL);
+                event->length = snprintf(event->text, EVENT_LINE_MAX, "%d: Santa: going to sleep\n", *(task_counter));
                 break;
             case SANTA_HELPING:
-                fprintf(out_file,"%d: Santa: helping elves\n", *(task_counter));
-                fflush(NULL);
+                event->length = snprintf(event->text, EVENT_LINE_MAX, "%d: Santa: helping elves\n", *(task_counter));
                 break;
             case SANTA_CLOSING:
-                fprintf(out_file,"%d: Santa: closing workshop\n", *(task_counter));
-                fflush(NULL);
+                event->length = snprintf(event->text, EVENT_LINE_MAX, "%d: Santa: closing workshop\n", *(task_counter));
                 break;
             case SANTA_CHRISTMAS:
-                fprintf(out_file,"%d: Santa: Christmas started\n", *(task_counter));
-                fflush(NULL);
+                event->length = snprintf(event->text, EVENT_LINE_MAX, "%d: Santa: Christmas started\n", *(task_counter));
                 break;
         }
-    sem_post(writing_semaphore);
+    event_commit();
     
 }
 
@@ -449,34 +767,29 @@ void santa_output_text(santa_texts text){
  * @brief    This function send elf message to output file.
  * 
  * @details     The function choose right elf message by the enum value
- *              and will send it to the output file.
+ *              and will pass it to the writer process.
  *            
  * @param       text    The enum value thaht represent needed message.
  * @param       elf_id    Id of current elf to process.
  * 
 */
 void elf_output_text(elf_texts text, int elf_id){
-    sem_wait(writing_semaphore);
-        *(task_counter)+=1;
+    event_t *event = event_reserve();
         switch (text){
             case ELF_START:
-                fprintf(out_file,"%d: Elf %d: started\n", *(task_counter), elf_id);
-                fflush(NULL);
+                event->length = snprintf(event->text, EVENT_LINE_MAX, "%d: Elf %d: started\n", *(task_counter), elf_id);
                 break;
             case ELF_NEED_HELP:
-                fprintf(out_file,"%d: Elf %d: need help\n", *(task_counter), elf_id);
-                fflush(NULL);
+                event->length = snprintf(event->text, EVENT_LINE_MAX, "%d: Elf %d: need help\n", *(task_counter), elf_id);
                 break;
             case ELF_GET_HELP:
-                fprintf(out_file,"%d: Elf %d: get help\n", *(task_counter),elf_id);
-                fflush(NULL);
+                event->length = snprintf(event->text, EVENT_LINE_MAX, "%d: Elf %d: get help\n", *(task_counter),elf_id);
                 break;
             case ELF_HOLIDAY:
-                fprintf(out_file,"%d: Elf %d: taking holidays\n", *(task_counter),elf_id);
-                fflush(NULL);
+                event->length = snprintf(event->text, EVENT_LINE_MAX, "%d: Elf %d: taking holidays\n", *(task_counter),elf_id);
                 break;
         }
-    sem_post(writing_semaphore);
+    event_commit();
 }
 
 /*!
@@ -485,30 +798,26 @@ void elf_output_text(elf_texts text, int elf_id){
  * @brief    This function send reindeer message to output file.
  * 
  * @details     The function choose right reindeer message by the enum value
- *              and will send it to the output file.
+ *              and will pass it to the writer process.
  *            
  * @param       text    The enum value thaht represent needed message.
  * @param       reindeer_id    Id of current reindeer to process.
  * 
 */
 void reindeer_output_text(reindeer_texts text, int reindeer_id){
-     sem_wait(writing_semaphore);
-        *(task_counter)+=1;
+    event_t *event = event_reserve();
         switch (text){
             case REINDEER_RST:
-                fprintf(out_file,"%d: RD %d: rstarted\n", *(task_counter), reindeer_id);
-                fflush(NULL);
+                event->length = snprintf(event->text, EVENT_LINE_MAX, "%d: RD %d: rstarted\n", *(task_counter), reindeer_id);
                 break;
             case REINDEER_HOME:
-                fprintf(out_file,"%d: RD %d: return home\n", *(task_counter), reindeer_id);
-                fflush(NULL);
+                event->length = snprintf(event->text, EVENT_LINE_MAX, "%d: RD %d: return home\n", *(task_counter), reindeer_id);
                 break;
             case REINDEER_GET:
-                fprintf(out_file,"%d: RD %d: get hitched\n", *(task_counter), reindeer_id);
-                fflush(NULL);
+                event->length = snprintf(event->text, EVENT_LINE_MAX, "%d: RD %d: get hitched\n", *(task_counter), reindeer_id);
                 break;
         }
-    sem_post(writing_semaphore);
+    event_commit();
 }
 
 
@@ -519,12 +828,15 @@ void reindeer_output_text(reindeer_texts text, int reindeer_id){
  * 
  * @details     The function choose right error message by the enum value
  *              and will send it to the output file.
+ *              Created processes are stopped and all messages passed 
+ *              to the writer process are written before exit.
  *            
  * @param       error    The enum value thaht represent needed error message.
  * 
  * 
 */
 void error_message(error_type error){
+    writer_stop();
     switch (error){
         case PARAM_ERROR :
             fprintf(stderr, "Parameters loading error !!\n");
@@ -538,6 +850,10 @@ void error_message(error_type error){
             fprintf(stderr, "Create process error !!\n");
             exit(1);
             break;
+        case WRITE_ERROR : 
+            fprintf(stderr, "Error with writing proj2.out file !!\n");
+            exit(1);
+            break;
         default :
             fprintf(stderr, "Unexpected error !!\n");
             exit(1);
@@ -0,0 +1,446 @@
+/**
+ * Projekt 2 - (Synchronizace) Santa Claus problem
+ * Benchmark and regression harness for proj2
+ * Predmet IOS 2020/21
+ * @author Kristián Kičinka
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <signal.h>
+#include <errno.h>
+#include <time.h>
+#include <limits.h>
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#define BENCH_PROGRAM "./proj2"
+#define BENCH_OUTPUT "proj2.out"
+#define BENCH_WORK_DIR "/tmp/proj2_bench.XXXXXX"
+#define BENCH_WARMUP 1
+#define BENCH_RUNS 5
+#define BENCH_TIMEOUT 60
+#define BENCH_THRESHOLD 0.10
+#define BENCH_MIN_DELTA_MS 5.0
+#define BENCH_RATE_THRESHOLD 0.10
+#define BENCH_CSW_THRESHOLD 0.25
+#define BENCH_MIN_DELTA_CSW 50
+#define BENCH_RSS_THRESHOLD 0.20
+#define BENCH_MIN_DELTA_RSS_KB 256
+#define BENCH_LINE_MAX 256
+
+// BENCHMARK SCENARIO STRUCTURE
+typedef struct bench_scenario{
+    const char *name;
+    const char *elfs_count;
+    const char *reindeers_count;
+    const char *max_working_time;
+    const char *max_holiday_time;
+}bench_scenario_t;
+
+// ONE MEASURED RUN STRUCTURE
+typedef struct bench_run{
+    double wall_ms;
+    long events;
+    long ctx_switches;
+    long max_rss_kb;
+}bench_run_t;
+
+// SCENARIO RESULT STRUCTURE
+typedef struct bench_result{
+    char name[BENCH_LINE_MAX];
+    double median_ms;
+    double iqr_ms;
+    long events;
+    double events_per_sec;
+    long ctx_switches;
+    long max_rss_kb;
+}bench_result_t;
+
+// FIXED SCENARIO MATRIX
+static const bench_scenario_t scenarios[] = {
+    {"tiny",        "1",   "1",  "0",  "0"},
+    {"elves_999",   "999", "19", "0",  "0"},
+    {"zero_work",   "50",  "10", "0",  "10"},
+    {"max_holiday", "5",   "4",  "10", "1000"},
+};
+
+#define SCENARIOS_COUNT ((int)(sizeof(scenarios) / sizeof(scenarios[0])))
+
+// Process group of the currently measured run
+static volatile sig_atomic_t running_group = 0;
+
+// Absolute path of proj2 and temporary directory where it runs
+static char program_path[PATH_MAX];
+static char work_dir[] = BENCH_WORK_DIR;
+static char output_path[PATH_MAX];
+
+// Functions declaration
+void timeout_handler(int signal_number);
+bool run_scenario(const bench_scenario_t *scenario, bench_run_t *run);
+long count_events();
+int compare_doubles(const void *first, const void *second);
+double quantile(double *values, int count, double position);
+void summarize_runs(const bench_scenario_t *scenario, bench_run_t *runs, int count, bench_result_t *result);
+bool write_results(const char *path, bench_result_t *results, int count);
+bool check_metric(const char *name, const char *unit, double base, double current,
+                  double threshold, double min_delta, bool lower_is_worse);
+int compare_baseline(const char *path, bench_result_t *results, int count);
+
+
+int main( int argc, char *argv[] ) {
+    if(argc < 2 || argc > 3){
+        fprintf(stderr, "Usage: %s RESULTS_FILE [BASELINE_FILE]\n", argv[0]);
+        return 1;
+    }
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = timeout_handler;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGALRM, &action, NULL);
+
+    if(realpath(BENCH_PROGRAM, program_path) == NULL){
+        fprintf(stderr, "Program %s not found !!\n", BENCH_PROGRAM);
+        return 1;
+    }
+    if(mkdtemp(work_dir) == NULL){
+        fprintf(stderr, "Error with creating temporary directory !!\n");
+        return 1;
+    }
+    snprintf(output_path, sizeof(output_path), "%s/%s", work_dir, BENCH_OUTPUT);
+
+    bench_result_t results[SCENARIOS_COUNT];
+    bench_run_t runs[BENCH_RUNS];
+    bool error = false;
+
+    for (int i = 0; i < SCENARIOS_COUNT && !error; i++){
+        const bench_scenario_t *scenario = &scenarios[i];
+
+        for (int w = 0; w < BENCH_WARMUP && !error; w++)
+            error = !run_scenario(scenario, &runs[0]);
+        for (int r = 0; r < BENCH_RUNS && !error; r++)
+            error = !run_scenario(scenario, &runs[r]);
+        if(error)
+            break;
+
+        summarize_runs(scenario, runs, BENCH_RUNS, &results[i]);
+        printf("%-12s median %9.2f ms  iqr %8.2f ms  %10.0f events/s  %8ld csw  %8ld KiB\n",
+               results[i].name, results[i].median_ms, results[i].iqr_ms,
+               results[i].events_per_sec, results[i].ctx_switches, results[i].max_rss_kb);
+    }
+
+    unlink(output_path);
+    rmdir(work_dir);
+
+    if(error || !write_results(argv[1], results, SCENARIOS_COUNT))
+        return 1;
+
+    if(argc == 3)
+        return compare_baseline(argv[2], results, SCENARIOS_COUNT);
+
+    return 0;
+}
+
+/*!
+ * @name    timeout_handler
+ *
+ * @brief    This function kill the measured run when it takes too long.
+ *
+ * @param       signal_number    Number of received signal.
+ *
+*/
+void timeout_handler(int signal_number){
+    (void)signal_number;
+    if(running_group > 0)
+        kill(-running_group, SIGKILL);
+}
+
+/*!
+ * @name    run_scenario
+ *
+ * @brief    This function run proj2 once with scenario parameters and measure it.
+ *
+ * @details     The function start proj2 in its own process group, so all elves,
+ *              reindeers and santa can be killed after timeout. proj2 runs in 
+ *              the temporary directory, so proj2.out in the working tree is not changed. Wall time is measured
+ *              by monotonic clock, context switches and max RSS are taken from rusage
+ *              of proj2 and all its waited processes.
+ *
+ * @param       scenario    The scenario that will be run.
+ * @param       run    The structure where measured values will be stored.
+ *
+ * @return      false if the run failed, true otherwise.
+*/
+bool run_scenario(const bench_scenario_t *scenario, bench_run_t *run){
+    struct timespec start, end;
+    struct rusage usage;
+    int status;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    pid_t pid = fork();
+    switch (pid){
+    case 0 :
+        setpgid(0, 0);
+        if(chdir(work_dir) == -1)
+            _exit(127);
+        execl(program_path, program_path, scenario->elfs_count, scenario->reindeers_count,
+              scenario->max_working_time, scenario->max_holiday_time, (char *)NULL);
+        _exit(127);
+    case -1 :
+        fprintf(stderr, "Create process error !!\n");
+        return false;
+    default :
+        break;
+    }
+
+    setpgid(pid, pid);
+    running_group = pid;
+    alarm(BENCH_TIMEOUT);
+
+    pid_t waited;
+    while ((waited = wait4(pid, &status, 0, &usage)) == -1 && errno == EINTR)
+        ;
+
+    alarm(0);
+    running_group = 0;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    if(waited == -1 || !WIFEXITED(status) || WEXITSTATUS(status) != 0){
+        fprintf(stderr, "Scenario %s failed or timed out !!\n", scenario->name);
+        return false;
+    }
+
+    run->wall_ms = (end.tv_sec - start.tv_sec) * 1000.0 + (end.tv_nsec - start.tv_nsec) / 1000000.0;
+    run->ctx_switches = usage.ru_nvcsw + usage.ru_nivcsw;
+    run->max_rss_kb = usage.ru_maxrss;
+    run->events = count_events();
+
+    return run->events >= 0;
+}
+
+/*!
+ * @name    count_events
+ *
+ * @brief    This function count events written by proj2 to its output file 
+ *           in the temporary directory.
+ *
+ * @return      count of output lines or -1 on error.
+*/
+long count_events(){
+    FILE *file;
+    long events = 0;
+    int c;
+
+    if((file = fopen(output_path, "r")) == NULL){
+        fprintf(stderr, "Error with opening proj2.out file !!\n");
+        return -1;
+    }
+    while ((c = fgetc(file)) != EOF){
+        if(c == '\n')
+            events++;
+    }
+    fclose(file);
+    return events;
+}
+
+/*!
+ * @name    compare_doubles
+ *
+ * @brief    This function compare two doubles for qsort.
+ *
+*/
+int compare_doubles(const void *first, const void *second){
+    double a = *(const double *)first;
+    double b = *(const double *)second;
+    return (a > b) - (a < b);
+}
+
+/*!
+ * @name    quantile
+ *
+ * @brief    This function calculate quantile of sorted values by linear interpolation.
+ *
+ * @param       values    Sorted array of values.
+ * @param       count    Count of values.
+ * @param       position    Quantile position from 0 to 1.
+ *
+ * @return      value of the quantile.
+*/
+double quantile(double *values, int count, double position){
+    double index = position * (count - 1);
+    int lower = (int)index;
+    if(lower + 1 >= count)
+        return values[count - 1];
+    return values[lower] + (index - lower) * (values[lower + 1] - values[lower]);
+}
+
+/*!
+ * @name    summarize_runs
+ *
+ * @brief    This function calculate scenario result from all measured runs.
+ *
+ * @details     Wall time is reported as median and interquartile range,
+ *              events and context switches as median, max RSS as maximum.
+ *
+ * @param       scenario    The measured scenario.
+ * @param       runs    Array of measured runs.
+ * @param       count    Count of measured runs.
+ * @param       result    The structure where result will be stored.
+ *
+*/
+void summarize_runs(const bench_scenario_t *scenario, bench_run_t *runs, int count, bench_result_t *result){
+    double wall[BENCH_RUNS];
+    double events[BENCH_RUNS];
+    double ctx_switches[BENCH_RUNS];
+
+    result->max_rss_kb = 0;
+    for (int i = 0; i < count; i++){
+        wall[i] = runs[i].wall_ms;
+        events[i] = runs[i].events;
+        ctx_switches[i] = runs[i].ctx_switches;
+        if(runs[i].max_rss_kb > result->max_rss_kb)
+            result->max_rss_kb = runs[i].max_rss_kb;
+    }
+    qsort(wall, count, sizeof(double), compare_doubles);
+    qsort(events, count, sizeof(double), compare_doubles);
+    qsort(ctx_switches, count, sizeof(double), compare_doubles);
+
+    snprintf(result->name, sizeof(result->name), "%s", scenario->name);
+    result->median_ms = quantile(wall, count, 0.5);
+    result->iqr_ms = quantile(wall, count, 0.75) - quantile(wall, count, 0.25);
+    result->events = (long)quantile(events, count, 0.5);
+    result->ctx_switches = (long)quantile(ctx_switches, count, 0.5);
+    result->events_per_sec = result->median_ms > 0 ? result->events / (result->median_ms / 1000.0) : 0;
+}
+
+/*!
+ * @name    write_results
+ *
+ * @brief    This function write scenario results to CSV file.
+ *
+ * @param       path    Path of the results file.
+ * @param       results    Array of scenario results.
+ * @param       count    Count of scenario results.
+ *
+ * @return      false if the file can not be written, true otherwise.
+*/
+bool write_results(const char *path, bench_result_t *results, int count){
+    FILE *file;
+
+    if((file = fopen(path, "w")) == NULL){
+        fprintf(stderr, "Error with opening %s file !!\n", path);
+        return false;
+    }
+    fprintf(file, "scenario,median_ms,iqr_ms,events,events_per_sec,ctx_switches,max_rss_kb\n");
+    for (int i = 0; i < count; i++){
+        fprintf(file, "%s,%.3f,%.3f,%ld,%.1f,%ld,%ld\n", results[i].name, results[i].median_ms,
+                results[i].iqr_ms, results[i].events, results[i].events_per_sec,
+                results[i].ctx_switches, results[i].max_rss_kb);
+    }
+    fclose(file);
+    return true;
+}
+
+/*!
+ * @name    check_metric
+ *
+ * @brief    This function compare one metric against baseline and print the result.
+ *
+ * @details     Metric is flagged as regression when it is worse than baseline
+ *              by more than threshold (relative) and also by more than min_delta (absolute).
+ *
+ * @param       name    Scenario name.
+ * @param       unit    Unit of the metric.
+ * @param       base    Baseline value.
+ * @param       current    Current value.
+ * @param       threshold    Allowed relative change.
+ * @param       min_delta    Allowed absolute change.
+ * @param       lower_is_worse    True if lower value is worse (rates).
+ *
+ * @return      true if the metric regressed, false otherwise.
+*/
+bool check_metric(const char *name, const char *unit, double base, double current,
+                  double threshold, double min_delta, bool lower_is_worse){
+    double delta = lower_is_worse ? base - current : current - base;
+    double change = base > 0 ? (current - base) / base : 0;
+    bool regression = base > 0 && delta / base > threshold && delta > min_delta;
+
+    printf("%-12s %12.2f -> %12.2f %-9s %+7.1f %%%s\n", name, base, current, unit,
+           change * 100, regression ? "  REGRESSION" : "");
+    return regression;
+}
+
+/*!
+ * @name    compare_baseline
+ *
+ * @brief    This function compare results against stored baseline.
+ *
+ * @details     All measured metrics are compared by check_metric. Median wall time
+ *              and events per second may change by BENCH_THRESHOLD and BENCH_RATE_THRESHOLD
+ *              and also by the noise given by both interquartile ranges and BENCH_MIN_DELTA_MS,
+ *              so normal noise of short scenarios is ignored. Context switches and max RSS
+ *              may grow by BENCH_CSW_THRESHOLD and BENCH_RSS_THRESHOLD and at least
+ *              by BENCH_MIN_DELTA_CSW and BENCH_MIN_DELTA_RSS_KB.
+ *              Scenarios missing in baseline are only reported.
+ *
+ * @param       path    Path of the baseline file.
+ * @param       results    Array of scenario results.
+ * @param       count    Count of scenario results.
+ *
+ * @return      0 if no regression was found, 1 otherwise.
+*/
+int compare_baseline(const char *path, bench_result_t *results, int count){
+    FILE *file;
+    char line[BENCH_LINE_MAX];
+    bool found[SCENARIOS_COUNT] = {false};
+    int regressions = 0;
+
+    if((file = fopen(path, "r")) == NULL){
+        fprintf(stderr, "Error with opening %s file !!\n", path);
+        return 1;
+    }
+
+    while (fgets(line, sizeof(line), file) != NULL){
+        bench_result_t base;
+        if(sscanf(line, "%255[^,],%lf,%lf,%ld,%lf,%ld,%ld", base.name, &base.median_ms, &base.iqr_ms,
+                  &base.events, &base.events_per_sec, &base.ctx_switches, &base.max_rss_kb) != 7)
+            continue;
+
+        for (int i = 0; i < count; i++){
+            if(strcmp(base.name, results[i].name) != 0)
+                continue;
+
+            found[i] = true;
+            double noise_ms = results[i].iqr_ms + base.iqr_ms + BENCH_MIN_DELTA_MS;
+            double noise_rate = base.median_ms > 0 ? base.events_per_sec * noise_ms / base.median_ms : 0;
+
+            if(check_metric(results[i].name, "ms", base.median_ms, results[i].median_ms,
+                            BENCH_THRESHOLD, noise_ms, false))
+                regressions++;
+            if(check_metric(results[i].name, "events/s", base.events_per_sec, results[i].events_per_sec,
+                            BENCH_RATE_THRESHOLD, noise_rate, true))
+                regressions++;
+            if(check_metric(results[i].name, "csw", base.ctx_switches, results[i].ctx_switches,
+                            BENCH_CSW_THRESHOLD, BENCH_MIN_DELTA_CSW, false))
+                regressions++;
+            if(check_metric(results[i].name, "KiB", base.max_rss_kb, results[i].max_rss_kb,
+                            BENCH_RSS_THRESHOLD, BENCH_MIN_DELTA_RSS_KB, false))
+                regressions++;
+        }
+    }
+    fclose(file);
+
+    for (int i = 0; i < count; i++){
+        if(!found[i])
+            printf("%-12s missing in baseline\n", results[i].name);
+    }
+
+    return regressions > 0 ? 1 : 0;
+}